@@ -66,6 +66,13 @@ enum {
     ROP_FBX_DETECTCONSTPOINTOBJS,
     ROP_FBX_CONVERTSURFACES,
     ROP_FBX_CONSERVEMEM,
+    ROP_FBX_VCMEMORYBUDGET,
+    ROP_FBX_REUSEVCFILES,
+    ROP_FBX_REDUCEKEYS,
+    ROP_FBX_REDUCEKEYSTOLERANCE,
+    ROP_FBX_ANIMTAKES,
+    ROP_FBX_ADAPTIVERESAMPLE,
+    ROP_FBX_ADAPTIVERESAMPLETOLERANCE,
     ROP_FBX_DEFORMSASVCS,
     ROP_FBX_FORCEBLENDSHAPE,
     ROP_FBX_FORCESKINDEFORM,
@@ -153,6 +160,27 @@ private:
     int CONSERVEMEM(void)
     { INT_PARM("conservemem", 0, 0) }
 
+    int VCMEMORYBUDGET(void)
+    { INT_PARM("vcmemorybudget", 0, 0) }
+
+    int REUSEVCFILES(void)
+    { INT_PARM("reusevcfiles", 0, 0) }
+
+    int REDUCEKEYS(void)
+    { INT_PARM("reducekeys", 0, 0) }
+
+    float REDUCEKEYSTOLERANCE(void)
+    { FBX_FLOAT_PARM("reducekeystolerance", 0, 0) }
+
+    void ANIMTAKES(UT_String& str)
+    { STR_PARM("animtakes",  0, 0); }
+
+    int ADAPTIVERESAMPLE(void)
+    { INT_PARM("adaptiveresample", 0, 0) }
+
+    float ADAPTIVERESAMPLETOLERANCE(void)
+    { FBX_FLOAT_PARM("adaptiveresampletolerance", 0, 0) }
+
     int FORCEBLENDSHAPE(void)
     { INT_PARM("forceblendshape", 0, 0) }
 
@@ -36,9 +36,12 @@
 #include "ROP_FBXCommon.h"
 #include "ROP_FBXBaseVisitor.h"
 
+#include <UT/UT_Array.h>
+#include <UT/UT_IntArray.h>
 #include <UT/UT_VectorTypes.h>
 
 #include <string>
+#include <vector>
 
 
 class ROP_FBXActionManager;
@@ -46,6 +49,7 @@ class ROP_FBXErrorManager;
 class ROP_FBXExporter;
 class ROP_FBXNodeInfo;
 class ROP_FBXNodeManager;
+class ROP_FBXResampleJob;
 
 class OBJ_Node;
 class SOP_Node;
@@ -81,20 +85,49 @@ public:
 
     void reset(FbxAnimLayer* curr_layer);
 
+    /// If false, deforming geometry doesn't get its vertex cache written again. True by default.
+    void setExportVertexCaches(bool value);
+
+    /// If false, other animation stacks are exported as well, so values that are static in
+    /// this one can't be stored in the (shared) properties themselves. True by default.
+    void setIsSingleAnimStack(bool value);
+
+    /// If true, vertex caches are cooked again in the current take instead of using the
+    /// positions stored while exporting the geometry in another one. False by default.
+    void setRecaptureVertexCaches(bool value);
+
     void exportTRSAnimation(OP_Node* node, FbxAnimLayer* curr_fbx_anim_layer, FbxNode* fbx_node);
 
+    /// Exports the animation of the nodes the main visitor found could be animated, instead
+    /// of visiting the whole scene. Returns false if the export was interrupted.
+    bool exportAnimatedNodes(void);
+
+    /// Resamples the transforms of all the nodes queued up while visiting, sweeping the frame
+    /// range only once for all of them. Returns false if the export was interrupted.
+    bool exportQueuedResampledAnimation(void);
+
 protected:
 
+    void exportNodeAnimation(OP_Node* node, OBJ_Node* obj_node, ROP_FBXNodeInfo* stored_node_info_ptr, ROP_FBXBaseNodeVisitInfo* node_info_in);
     void exportResampledAnimation(FbxAnimLayer* curr_fbx_anim_layer, OP_Node* source_node, FbxNode* fbx_node, ROP_FBXBaseNodeVisitInfo *node_info);
+    void getResampleTimes(UT_FprealArray& times_out);
     void exportChannel(FbxAnimCurve* fbx_anim_curve, OP_Node* source_node, const char* parm_name, int parm_idx, double scale_factor = 1.0, const int& param_inst = -1);
     void outputResampled(FbxAnimCurve* fbx_curve, CH_Channel *ch, int start_array_idx, int end_array_idx, UT_FprealArray& time_array, bool do_insert, PRM_Parm* direct_eval_parm, int parm_idx, double scale_factor = 1.0);
 
     bool outputVertexCache(FbxNode* fbx_node, OP_Node* geo_node, const char* file_name, ROP_FBXBaseNodeVisitInfo* node_info_in, ROP_FBXNodeInfo* node_pair_info);
     FbxVertexCacheDeformer* addedVertexCacheDeformerToNode(FbxNode* fbx_node, const char* file_name);
-    bool fillVertexArray(OP_Node* node, fpreal time, ROP_FBXBaseNodeVisitInfo* node_info_in, double* vert_array, int num_array_points, ROP_FBXNodeInfo* node_pair_info, fpreal frame_num);
-    int lookupExactPointCount(OP_Node *node, fpreal time, int selected_prim_idx);
+    /// Returns true if all frames were evaluated and written.
+    template <typename WRITER>
+    bool writeVertexCacheFrames(WRITER& cache_writer, OP_Node* geo_node, ROP_FBXBaseNodeVisitInfo* node_info_in, int num_vc_points, ROP_FBXNodeInfo* node_pair_info);
+    template <typename FLOAT_T>
+    bool fillVertexArray(OP_Node* node, fpreal time, ROP_FBXBaseNodeVisitInfo* node_info_in, FLOAT_T* vert_array, int num_array_points, ROP_FBXNodeInfo* node_pair_info, fpreal frame_num);
 
     bool exportBlendShapeAnimation(OP_Node* blend_shape_node, FbxNode* fbx_node);
+
+    void releaseVisitInfos(void);
+    /// Samples the given blend shape channels, whose weights are read from parms, over the
+    /// whole frame range at once.
+    void exportResampledBlendShapeWeights(FbxBlendShape* fbx_blend, const UT_IntArray& channels, const UT_Array<PRM_Parm*>& parms);
 private:
 
     ROP_FBXExporter* myParentExporter;
@@ -106,9 +139,17 @@ private:
     ROP_FBXExportOptions *myExportOptions;
 
     FbxAnimLayer* myAnimLayer;
+    bool myExportVertexCaches;
+    bool myIsSingleAnimStack;
+    bool myRecaptureVertexCaches;
 
     std::string myOutputFileName, myFBXFileSourceFolder, myFBXShortFileName;
     UT_Interrupt* myBoss;
+
+    /// Nodes whose transforms are waiting to be resampled by exportQueuedResampledAnimation().
+    std::vector<ROP_FBXResampleJob*> myResampleJobs;
+
+    ROP_FBXVisitInfoPool<ROP_FBXBaseNodeVisitInfo> myVisitInfoPool;
 };
 /********************************************************************************************************/
 #endif
@@ -34,9 +34,13 @@
 
 #include "ROP_FBXCommon.h"
 #include "ROP_FBXHeaderWrapper.h"
+#include <UT/UT_Array.h>
+#include <UT/UT_ArrayMap.h>
+#include <UT/UT_IntArray.h>
 #include <UT/UT_StringArray.h>
 
 #include <map>
+#include <new>
 #include <string>
 #include <vector>
 
@@ -118,10 +122,82 @@ private:
     std::vector<OP_Node*> myBlendShapeNodes;
 };
 
-typedef std::multimap < OP_Node*, ROP_FBXBaseNodeVisitInfo* > TBaseNodeVisitInfos;
 typedef std::vector < ROP_FBXBaseNodeVisitInfo* > TBaseNodeVisitInfoVector;
+typedef UT_ArrayMap < OP_Node*, TBaseNodeVisitInfoVector > TBaseNodeVisitInfos;
 typedef std::vector < OP_Node* > THDNodeVector;
 /********************************************************************************************************/
+/// Hands out visit infos from blocks that are kept around between visits, instead of
+/// allocating each one on its own. All of them are destroyed at once by clear().
+template <typename VISIT_INFO>
+class ROP_FBXVisitInfoPool
+{
+public:
+    ROP_FBXVisitInfoPool() : myNumUsed(0) { }
+    ~ROP_FBXVisitInfoPool()
+    {
+	clear();
+	for(exint curr_block = 0; curr_block < myBlocks.size(); curr_block++)
+	    ::operator delete(myBlocks(curr_block));
+    }
+
+    VISIT_INFO* alloc(OP_Node* hd_node)
+    {
+	if(myNumUsed == myBlocks.size() * theBlockSize)
+	    myBlocks.append(static_cast<VISIT_INFO*>(::operator new(sizeof(VISIT_INFO) * theBlockSize)));
+	VISIT_INFO* info = getInfo(myNumUsed);
+	new (info) VISIT_INFO(hd_node);
+	myNumUsed++;
+	return info;
+    }
+
+    void clear(void)
+    {
+	for(exint curr_info = 0; curr_info < myNumUsed; curr_info++)
+	    getInfo(curr_info)->~VISIT_INFO();
+	myNumUsed = 0;
+    }
+
+private:
+    VISIT_INFO* getInfo(exint index) { return myBlocks(index / theBlockSize) + (index % theBlockSize); }
+
+    static const exint theBlockSize = 256;
+    UT_Array<VISIT_INFO*> myBlocks;
+    exint myNumUsed;
+};
+/********************************************************************************************************/
+/// The hierarchy outputs of the nodes visited so far, in the order they're visited in,
+/// along with the input each one is connected to. Rows are stored back to back so that
+/// walking the outputs of a node again doesn't need OP_OutputIterator or any scan of
+/// the target's inputs. Connections don't depend on time or takes, so the same index can
+/// be shared by all the visitors of an export.
+class ROP_FBXTraversalIndex
+{
+public:
+    ROP_FBXTraversalIndex();
+    ~ROP_FBXTraversalIndex();
+
+    void clear(void);
+
+    /// Returns the row holding the outputs of hd_node, adding it first if needed.
+    exint getRow(OP_Node* hd_node);
+
+    exint getRowStart(exint row) const { return myRowStarts(row); }
+    exint getRowEnd(exint row) const { return myRowStarts(row + 1); }
+
+    OP_Node* getTarget(exint connection) const { return myTargets(connection); }
+    /// Index of the input on the target the connection goes into.
+    int getTargetInput(exint connection) const { return myTargetInputs(connection); }
+    /// Number of earlier connections in the same row going to the same target.
+    int getConnectionCount(exint connection) const { return myConnectionCounts(connection); }
+
+private:
+    UT_ArrayMap<OP_Node*, exint> myRows;
+    UT_Array<exint> myRowStarts;
+    UT_Array<OP_Node*> myTargets;
+    UT_IntArray myTargetInputs;
+    UT_IntArray myConnectionCounts;
+};
+/********************************************************************************************************/
 class ROP_FBXBaseVisitor
 {
 public:
@@ -129,7 +205,8 @@ public:
     virtual ~ROP_FBXBaseVisitor();
 
     /// Called before visiting a node. Must return a new instance of
-    /// the node info visit structure or a class derived from it.
+    /// the node info visit structure or a class derived from it, which
+    /// stays valid until releaseVisitInfos() is called.
     virtual ROP_FBXBaseNodeVisitInfo* visitBegin(OP_Node* node, int input_idx_on_this_node) = 0;
 
     virtual ROP_FBXVisitorResultType visit(OP_Node* node, ROP_FBXBaseNodeVisitInfo* node_info) = 0;
@@ -144,6 +221,14 @@ public:
 
     bool getDidCancel(void);
 
+    /// Lets several visitors share the outputs they've looked up. By default, each visitor
+    /// has its own index.
+    void setTraversalIndex(ROP_FBXTraversalIndex* traversal_index);
+
+protected:
+    /// Called once the visit infos returned by visitBegin() are no longer needed.
+    virtual void releaseVisitInfos(void) = 0;
+
 private:
     /// Calls visit() on the specified node and then calls itself
     /// on all children.
@@ -170,6 +255,9 @@ private:
 
     TBaseNodeVisitInfos myAllVisitInfos;
     fpreal myStartTime;
+
+    ROP_FBXTraversalIndex myOwnTraversalIndex;
+    ROP_FBXTraversalIndex* myTraversalIndex;
 };
 /********************************************************************************************************/
 #endif
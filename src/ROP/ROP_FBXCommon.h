@@ -62,7 +62,10 @@ static const char* const ROP_FBXallowed_inbetween_node_types[] = {"null", "switc
 enum ROP_FBXVertexCacheExportFormatType
 {
     ROP_FBXVertexCacheExportFormatMaya = 0,
-    ROP_FBXVertexCacheExportFormat3DStudio
+    ROP_FBXVertexCacheExportFormat3DStudio,
+    ROP_FBXVertexCacheExportFormatMayaFloat,	// Maya MCC cache with float data.
+    ROP_FBXVertexCacheExportFormatMayaMCX,	// 64-bit Maya MCX cache with double data.
+    ROP_FBXVertexCacheExportFormatMayaMCXFloat	// 64-bit Maya MCX cache with float data.
 };
 enum ROP_FBXVertexCacheMethodType
 {
@@ -101,11 +104,43 @@ public:
     /// every N frames.
     void setResampleIntervalInFrames(fpreal frames);
 
+    /// If true, resampled curves only keep the keys needed to reproduce the sampled
+    /// values within the key reduction tolerance. Dropped runs of keys are bridged by
+    /// linear or cubic segments.
+    bool getReduceResampledKeys(void);
+    /// If true, resampled curves only keep the keys needed to reproduce the sampled
+    /// values within the key reduction tolerance. Dropped runs of keys are bridged by
+    /// linear or cubic segments.
+    void setReduceResampledKeys(bool value);
+
+    /// Largest difference, in channel units, allowed between a reduced curve and the
+    /// values it was resampled from.
+    fpreal getKeyReductionTolerance(void);
+    /// Largest difference, in channel units, allowed between a reduced curve and the
+    /// values it was resampled from.
+    void setKeyReductionTolerance(fpreal tolerance);
+
+    /// If true, resampled channels are sampled in coarse steps, which are subdivided, down to
+    /// a fraction of a frame, wherever linear interpolation strays from the channel by more
+    /// than the adaptive resampling tolerance.
+    bool getAdaptiveResampling(void);
+    /// If true, resampled channels are sampled in coarse steps, which are subdivided, down to
+    /// a fraction of a frame, wherever linear interpolation strays from the channel by more
+    /// than the adaptive resampling tolerance.
+    void setAdaptiveResampling(bool value);
+
+    /// Largest difference, in channel units, allowed between the channel and the linear
+    /// interpolation of its adaptively resampled keys.
+    fpreal getAdaptiveResamplingTolerance(void);
+    /// Largest difference, in channel units, allowed between the channel and the linear
+    /// interpolation of its adaptively resampled keys.
+    void setAdaptiveResamplingTolerance(fpreal tolerance);
+
     /// Specified the format to use for exporting vertex caches, whether compatbile 
-    /// with Maya's or 3DS MAX.
+    /// with Maya's (as doubles or floats, in a 32-bit MCC or a 64-bit MCX file) or 3DS MAX.
     void setVertexCacheFormat(ROP_FBXVertexCacheExportFormatType format_type);
     /// Specified the format to use for exporting vertex caches, whether compatbile 
-    /// with Maya's or 3DS MAX.
+    /// with Maya's (as doubles or floats, in a 32-bit MCC or a 64-bit MCX file) or 3DS MAX.
     ROP_FBXVertexCacheExportFormatType getVertexCacheFormat(void);
 
     /// If true, the exported file will be in the human-readable ASCII FBX format.
@@ -157,6 +192,19 @@ public:
     /// The name of the take to export. If empty, export the current take (default).
     const char* getExportTakeName(void);
 
+    /// Space-separated names of the takes whose animation is exported, each into its own
+    /// animation stack. The geometry is only exported once, from the export take. Vertex
+    /// caches are written only once too, in the export take if it's listed and otherwise in
+    /// the first of these takes that exists. If empty (default), only the animation of the
+    /// export take is exported.
+    void setAnimationTakes(const char* take_names);
+    /// Space-separated names of the takes whose animation is exported, each into its own
+    /// animation stack. The geometry is only exported once, from the export take. Vertex
+    /// caches are written only once too, in the export take if it's listed and otherwise in
+    /// the first of these takes that exists. If empty (default), only the animation of the
+    /// export take is exported.
+    const char* getAnimationTakes(void);
+
     /// Determines how invisible objects are to be exported.
     ROP_FBXInvisibleNodeExportType getInvisibleNodeExportMethod(void);
     /// Determines how invisible objects are to be exported.
@@ -191,6 +239,20 @@ public:
     /// less memory usage, but slower performance.
     bool getSaveMemory(void);
 
+    /// Memory budget, in megabytes, for vertex cache frame snapshots. Frames over the 
+    /// budget are spilled to a scratch file on disk. Zero (default) means no budget.
+    void setVertexCacheMemoryBudget(int budget_mb);
+    /// Memory budget, in megabytes, for vertex cache frame snapshots. Frames over the 
+    /// budget are spilled to a scratch file on disk. Zero (default) means no budget.
+    int getVertexCacheMemoryBudget(void);
+
+    /// If true, vertex cache files left by a previous export are kept as they are if the
+    /// geometry and cache settings they were written from haven't changed.
+    void setReuseVertexCacheFiles(bool value);
+    /// If true, vertex cache files left by a previous export are kept as they are if the
+    /// geometry and cache settings they were written from haven't changed.
+    bool getReuseVertexCacheFiles(void);
+
     /// If true, blendshape nodes found in geometry nodes will always be exported, potentially loosing
     /// informations doing so, as nodes modifying geometry after the blend shapes will be ignored.
     void setForceBlendShapeExport(bool value);
@@ -227,8 +289,26 @@ private:
     /// only the unsupported types will be.
     bool myResampleAllAnimation;
 
+    /// If true, resampled curves only keep the keys needed to reproduce the sampled
+    /// values within the key reduction tolerance. Dropped runs of keys are bridged by
+    /// linear or cubic segments.
+    bool myReduceResampledKeys;
+
+    /// Largest difference, in channel units, allowed between a reduced curve and the
+    /// values it was resampled from.
+    fpreal myKeyReductionTolerance;
+
+    /// If true, resampled channels are sampled in coarse steps, which are subdivided, down to
+    /// a fraction of a frame, wherever linear interpolation strays from the channel by more
+    /// than the adaptive resampling tolerance.
+    bool myAdaptiveResampling;
+
+    /// Largest difference, in channel units, allowed between the channel and the linear
+    /// interpolation of its adaptively resampled keys.
+    fpreal myAdaptiveResamplingTolerance;
+
     /// Specified the format to use for exporting vertex caches, whether compatbile 
-    /// with Maya's or 3DS MAX.
+    /// with Maya's (as doubles or floats, in a 32-bit MCC or a 64-bit MCX file) or 3DS MAX.
     ROP_FBXVertexCacheExportFormatType myVertexCacheFormat;
 
     /// If true, the exported file will be in the human-readable ASCII FBX format.
@@ -259,6 +339,13 @@ private:
     /// The name of the take to export. If empty, export the current take (default).
     std::string myExportTakeName;
 
+    /// Space-separated names of the takes whose animation is exported, each into its own
+    /// animation stack. The geometry is only exported once, from the export take. Vertex
+    /// caches are written only once too, in the export take if it's listed and otherwise in
+    /// the first of these takes that exists. If empty (default), only the animation of the
+    /// export take is exported.
+    std::string myAnimationTakes;
+
     /// Determines how invisible objects are to be exported.
     ROP_FBXInvisibleNodeExportType myInvisibleObjectsExportType;
 
@@ -277,6 +364,14 @@ private:
     /// less memory usage, but slower performance.
     bool mySaveMemory;
 
+    /// Memory budget, in megabytes, for vertex cache frame snapshots. Frames over the 
+    /// budget are spilled to a scratch file on disk. Zero (default) means no budget.
+    int myVertexCacheMemoryBudget;
+
+    /// If true, vertex cache files left by a previous export are kept as they are if the
+    /// geometry and cache settings they were written from haven't changed.
+    bool myReuseVertexCacheFiles;
+
     /// If true, blendshape nodes found in geometry nodes will always be exported, potentially loosing
     /// informations doing so, as nodes modifying geometry after the blend shapes will be ignored.
     bool myForceBlendShapeExport;
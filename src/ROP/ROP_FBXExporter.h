@@ -45,6 +45,7 @@
 
 class ROP_FBXNodeManager;
 class ROP_FBXActionManager;
+class OP_Node;
 class UT_Interrupt;
 
 typedef std::vector < char* > TCharPtrVector;
@@ -83,6 +84,13 @@ public:
 
 private:
     void deallocateQueuedStrings(void);
+    /// Exports the animation of the current take into a new animation stack named after it.
+    /// If visit_animated_only is true, only the nodes the geometry export found could be
+    /// animated are looked at, which is only valid for the take it ran in. is_single_stack is
+    /// false when more than one take gets exported. recapture_vertex_caches is set when the
+    /// current take isn't the one the geometry was exported in.
+    void exportTakeAnimation(OP_Node* geom_node, bool export_vertex_caches, bool visit_animated_only, bool is_single_stack,
+			     bool recapture_vertex_caches);
 
 private:
 
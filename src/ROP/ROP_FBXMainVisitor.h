@@ -34,9 +34,13 @@
 
 #include <UT/UT_Color.h>
 #include <UT/UT_Array.h>
+#include <UT/UT_ArrayMap.h>
 #include <UT/UT_Assert.h>
+#include <UT/UT_IntArray.h>
 #include <UT/UT_String.h>
 #include <UT/UT_Set.h>
+#include <SYS/SYS_Hash.h>
+#include <GU/GU_DetailHandle.h>
 #include "ROP_FBXHeaderWrapper.h"
 #include "ROP_FBXCommon.h"
 #include "ROP_FBXBaseVisitor.h"
@@ -57,6 +61,7 @@ class OBJ_Node;
 class GU_Detail;
 class GU_PrimNURBCurve;
 class GU_PrimNURBSurf;
+class GU_PrimPacked;
 class GEO_Primitive;
 class GD_TrimRegion;
 class GA_Attribute;
@@ -88,6 +93,8 @@ typedef std::map < std::string, int > THdFbxStringIntMap;
 //typedef set < OP_Node* > THdNodeSet;
 typedef std::map < std::string , FbxTexture* > THdFbxTextureMap;
 typedef std::vector < FbxLayerElementTexture* > TFbxLayerElemsVector;
+typedef std::map < std::pair < exint, std::string >, FbxNodeAttribute* > THdPackedDetailMeshMap;
+typedef std::map < std::pair < std::string, std::string >, FbxNodeAttribute* > THdPackedFileMeshMap;
 //typedef std::vector < FbxNode* > TFbxNodesVector;
 /********************************************************************************************************/
 class ROP_FBXAttributeLayerManager
@@ -158,14 +165,55 @@ public:
     void setHdPrimitiveIndex(int prim_cnt) { myHdPrimCnt = prim_cnt; }
     int getHdPrimitiveIndex(void) { return myHdPrimCnt; }
 
+    UT_IntArray& getCVPointIndices(void) { return myCVPointIndices; }
+
     FbxNode* getFbxNode(void) { return myNode; }
 
+    // The detail to take per-primitive materials from, when it isn't the one of the node.
+    void setMaterialDetail(const GU_DetailHandle& gdh) { myMaterialGdh = gdh; }
+    const GU_DetailHandle& getMaterialDetail(void) { return myMaterialGdh; }
+
 private:
     FbxNode* myNode;
     int myHdPrimCnt;
+    UT_IntArray myCVPointIndices;
+    GU_DetailHandle myMaterialGdh;
 };
 typedef std::vector < ROP_FBXConstructionInfo > TFbxNodesVector;
 /********************************************************************************************************/
+// A mesh output by outputSharedPolygons(), with enough about its source detail to tell it
+// apart from another detail that happens to have the same content hash.
+class ROP_FBXSharedMesh
+{
+public:
+    ROP_FBXSharedMesh()
+    {
+	myMesh = NULL;
+	myNumPoints = myNumVertices = myNumPrimitives = myNumAttribs = 0;
+	myCheckHash = 0;
+    }
+    ROP_FBXSharedMesh(const GU_Detail* gdp, SYS_HashType share_key, FbxNodeAttribute* mesh);
+
+    bool isSameSource(const ROP_FBXSharedMesh& other) const
+    {
+	return myNumPoints == other.myNumPoints && myNumVertices == other.myNumVertices
+	    && myNumPrimitives == other.myNumPrimitives && myNumAttribs == other.myNumAttribs
+	    && myCheckHash == other.myCheckHash;
+    }
+
+    FbxNodeAttribute* getMesh(void) const { return myMesh; }
+
+private:
+    FbxNodeAttribute* myMesh;
+    exint myNumPoints;
+    exint myNumVertices;
+    exint myNumPrimitives;
+    exint myNumAttribs;
+    // Hashed apart from the content hash, from the share key, the point numbers of the
+    // vertices and P.
+    SYS_HashType myCheckHash;
+};
+/********************************************************************************************************/
 class ROP_FBXMainVisitor : public ROP_FBXBaseVisitor
 {
 public:
@@ -181,6 +229,8 @@ public:
 
 protected:
 
+    void releaseVisitInfos(void);
+
     // Given a gdp pointer, this will return a pointer to a gdp which consists of
     // only supported primitives for export. This may or may not be a converted geo.
     // The conversion_spare parm is the object which may be used for conversion - 
@@ -192,7 +242,14 @@ protected:
     void setProperName(FbxLayerElement* fbx_layer_elem, const GU_Detail* gdp, const GA_Attribute* attr);
     bool outputGeoNode(OP_Node* node, ROP_FBXMainNodeVisitInfo* node_info, FbxNode* parent_node, ROP_FBXGDPCache* &v_cache_out, bool& did_cancel_out, TFbxNodesVector& res_nodes);
     bool outputSOPNodeWithVC(SOP_Node* node, const UT_String& node_name, ROP_FBXMainNodeVisitInfo* node_info, ROP_FBXGDPCache *&v_cache_out, bool& did_cancel_out, TFbxNodesVector& res_nodes);
-    bool outputSOPNodeWithoutVC(SOP_Node* node, const UT_String& node_name, OP_Node* skin_deform_node, bool& did_cancel_out, TFbxNodesVector& res_nodes);
+    // Geometry that gets deformers of its own, such as a blend shape base, has to be output
+    // with allow_shared_geo off.
+    bool outputSOPNodeWithoutVC(SOP_Node* node, const UT_String& node_name, OP_Node* skin_deform_node, bool& did_cancel_out, TFbxNodesVector& res_nodes, bool allow_shared_geo);
+    // Outputs the packed primitives of gdp that can share their geometry as instances of a
+    // single mesh, parented under packed_root_out. Returns the geometry that is left to export,
+    // which is either gdp itself or a copy in remaining_gdh without those primitives.
+    const GU_Detail* outputPackedPrimitives(const GU_Detail* gdp, const char* node_name, OP_Node* mat_source_node, GU_DetailHandle& remaining_gdh, FbxNode*& packed_root_out);
+    FbxNodeAttribute* getPackedMesh(const GU_PrimPacked* packed_prim, const char* node_name, const UT_StringHolder& packed_mat_path);
     bool outputNullNode(OP_Node* node, ROP_FBXMainNodeVisitInfo* node_info, FbxNode* parent_node, TFbxNodesVector& res_nodes);
     bool outputLightNode(OP_Node* node, ROP_FBXMainNodeVisitInfo* node_info, FbxNode* parent_node, TFbxNodesVector& res_nodes);
     bool outputCameraNode(OP_Node* node, ROP_FBXMainNodeVisitInfo* node_info, FbxNode* parent_node, TFbxNodesVector& res_nodes);
@@ -209,11 +266,16 @@ protected:
     int createTexturesForMaterial(OP_Node* mat_node, FbxSurfaceMaterial* fbx_material, THdFbxTextureMap& tex_map);
 
     FbxNodeAttribute* outputPolygons(const GU_Detail* gdp, const char* node_name, int max_points, ROP_FBXVertexCacheMethodType vc_method);
+    // Like outputPolygons(), but reuses the mesh of an earlier detail with the same content and
+    // the same share_key, which should capture anything else that ends up in the mesh.
+    FbxNodeAttribute* outputSharedPolygons(const GU_Detail* gdp, const char* node_name, SYS_HashType share_key);
     void outputNURBSSurface(const GU_Detail* gdp, const char* node_name, OP_Node* skin_deform_node, int capture_frame, TFbxNodesVector& res_nodes);
     void addUserData(const GU_Detail* gdp, THDAttributeVector& hd_attribs, ROP_FBXAttributeLayerManager& attr_manager, FbxMesh* mesh_attr, FbxLayerElement::EMappingMode mapping_mode );
 
     void exportAttributes(const GU_Detail* gdp, FbxMesh* mesh_attr);
-    void exportMaterials(OP_Node* source_node, FbxNode* fbx_node);
+    // Per-primitive materials come from mat_gdp if given, or from the geometry of source_node.
+    // A packed_mat_path replaces the material of source_node for packed instances.
+    void exportMaterials(OP_Node* source_node, FbxNode* fbx_node, const GU_Detail* mat_gdp = NULL, const char* packed_mat_path = NULL);
 
     FbxSurfaceMaterial* generateFbxMaterial(OP_Node* mat_node, THdFbxMaterialMap& mat_map);
     FbxSurfaceMaterial* generateFbxMaterial(const char * mat_string, THdFbxStringMaterialMap& mat_map);
@@ -232,7 +294,7 @@ protected:
     void finalizeNewNode(ROP_FBXConstructionInfo& constr_info, OP_Node* hd_node, ROP_FBXMainNodeVisitInfo *node_info, FbxNode* fbx_parent_node, 
 	const UT_StringRef& override_node_type, const char* lookat_parm_name, ROP_FBXVisitorResultType res_type, 
 	ROP_FBXGDPCache *v_cache, bool is_visible);
-    void finalizeGeoNode(FbxNodeAttribute *res_attr, OP_Node* skin_deform_node, int capture_frame, int opt_prim_cnt, TFbxNodesVector& res_nodes);
+    void finalizeGeoNode(FbxNodeAttribute *res_attr, OP_Node* skin_deform_node, int capture_frame, int opt_prim_cnt, TFbxNodesVector& res_nodes, const char* node_name = NULL);
 
     void exportFBXTransform(fpreal t, const OBJ_Node *hd_node, FbxNode* fbx_node);
 
@@ -265,6 +327,16 @@ private:
     UT_Interrupt* myBoss;
 
     ROP_FBXCreateInstancesAction* myInstancesActionPtr;
+
+    // Meshes already output for packed geometry, keyed by the id of the packed detail or by
+    // the file of packed disk primitives, and by the material of the packed primitive.
+    THdPackedDetailMeshMap myPackedDetailMeshes;
+    THdPackedFileMeshMap myPackedFileMeshes;
+    // Meshes output by outputSharedPolygons(), keyed by content. Details that collide on the
+    // hash get a mesh of their own, kept alongside.
+    UT_ArrayMap<SYS_HashType, UT_Array<ROP_FBXSharedMesh> > mySharedMeshes;
+
+    ROP_FBXVisitInfoPool<ROP_FBXMainNodeVisitInfo> myVisitInfoPool;
 };
 /********************************************************************************************************/
 #endif
@@ -38,19 +38,27 @@
 #include "ROP_FBXMainVisitor.h"
 
 #include <GU/GU_Detail.h>
+#include <UT/UT_Array.h>
+#include <UT/UT_ArrayMap.h>
+#include <UT/UT_IntArray.h>
 #include <UT/UT_Matrix4.h>
+#include <UT/UT_Vector3.h>
 #include <UT/UT_Set.h>
 #include <UT/UT_VectorTypes.h>
+#include <SYS/SYS_Hash.h>
 #include <SYS/SYS_Types.h>
 
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <string>
+#include <fstream>
 
 
 class ROP_FBXGDPCache;
 class ROP_FBXMainNodeVisitInfo;
+class ROP_FBXTransformCache;
 
 class OBJ_Node;
 class SOP_Node;
@@ -66,6 +74,23 @@ class UT_String;
 class UT_StringRef;
 class UT_XformOrder;
 
+/********************************************************************************************************/
+// Clock ticks spent in the stages of ROP_FBXUtil::convertScratchGDPtoVertexCacheableGDP(), for 
+// conversions done on worker threads. Only filled in by debug builds.
+class ROP_FBXConversionTimes
+{
+public:
+    ROP_FBXConversionTimes()
+    {
+	myConvertTime = 0;
+	myConvexTime = 0;
+	myReorderTime = 0;
+    }
+
+    double myConvertTime;
+    double myConvexTime;
+    double myReorderTime;
+};
 /********************************************************************************************************/
 class ROP_FBXUtil
 {
@@ -81,23 +106,59 @@ public:
     static bool isVertexCacheable(OP_Network *op_net, bool include_deform_nodes, fpreal ftime, bool& found_particles, bool is_sop_export);
 
     static void convertParticleGDPtoPolyGDP(const GU_Detail* src_gdp, GU_Detail& out_gdp);
-    static void convertGeoGDPtoVertexCacheableGDP(const GU_Detail* src_gdp, float lod, bool do_triangulate_and_rearrange, GU_Detail& out_gdp, int& num_pre_proc_points);
+    static void convertGeoGDPtoVertexCacheableGDP(const GU_Detail* src_gdp, float lod, bool do_triangulate_and_rearrange, GU_Detail& out_gdp, int& num_pre_proc_points,
+	UT_Vector3FArray* pre_proc_positions = NULL);
+    /// Same as convertGeoGDPtoVertexCacheableGDP(), but converts conv_gdp in place instead of a copy.
+    /// If given, point_remap receives, for every output point, the index of the converted (but not
+    /// triangulated) point it came from. If times_out is given, the debug timings go there instead 
+    /// of the global ones, which aren't safe to update from worker threads.
+    static void convertScratchGDPtoVertexCacheableGDP(GU_Detail& conv_gdp, float lod, bool do_triangulate_and_rearrange, GU_Detail& out_gdp, int& num_pre_proc_points,
+	UT_Vector3FArray* pre_proc_positions = NULL, UT_IntArray* point_remap = NULL, ROP_FBXConversionTimes* times_out = NULL);
+
+    /// Copies the positions of all points of gdp, in index order.
+    static void getPointPositions(const GU_Detail* gdp, UT_Vector3FArray& positions_out);
+    /// Fills vert_array with num_array_points positions of gdp, in index order. Any points
+    /// beyond the end of gdp are zeroed.
+    static void getPointPositions(const GU_Detail* gdp, double* vert_array, int num_array_points);
+    static void getPointPositions(const GU_Detail* gdp, float* vert_array, int num_array_points);
+    /// Copies num_points positions into vert_array, zeroing the rest of the num_array_points.
+    static void copyPositionsToArray(const UT_Vector3F* positions, int num_points, double* vert_array, int num_array_points);
+    static void copyPositionsToArray(const UT_Vector3F* positions, int num_points, float* vert_array, int num_array_points);
+    /// Finds the point indices of the CVs of a NURBS or Bezier primitive, in the order they're
+    /// written out to the vertex cache. The primitives are counted in the same order they are
+    /// exported in: NURBS surfaces, Bezier surfaces, Bezier curves and then NURBS curves. If 
+    /// source_prim_idx is negative, the CVs of all of them are concatenated.
+    static void getSurfaceCVPointIndices(const GU_Detail* gdp, int source_prim_idx, UT_IntArray& cv_points_out);
 
     static EFbxRotationOrder fbxRotationOrder(UT_XformOrder::xyzOrder rot_order);
     static bool mapsToFBXTransform(fpreal t, OBJ_Node* node);
+    /// Returns false only if nothing exported for hd_node can change over time: it's not time
+    /// dependent once cooked, and none of its parameters are animated or overridden.
+    static bool isPossiblyAnimated(OP_Node* hd_node, fpreal time);
+    /// Transform of hd_node relative to the parent it's exported under, moved to the end of
+    /// the bone if bone_length is non-zero.
+    static void getFinalTransform(OP_Node* hd_node, ROP_FBXBaseNodeVisitInfo *node_info, fpreal bone_length, fpreal time_in,
+	UT_Matrix4D& xform_out, ROP_FBXTransformCache* xform_cache = NULL);
     static void getFinalTransforms(OP_Node* hd_node, ROP_FBXBaseNodeVisitInfo *node_info, fpreal bone_length, fpreal time_in,
 	const UT_XformOrder& xform_order, UT_Vector3D& t_out, UT_Vector3D& r_out, UT_Vector3D& s_out,
-	UT_Vector3D* prev_frame_rotations);
+	UT_Vector3D* prev_frame_rotations, ROP_FBXTransformCache* xform_cache = NULL);
+    /// Explodes a sequence of transforms into translates, rotations (in degrees) and scales.
+    /// The rotations are kept continuous from each transform to the next.
+    static void explodeTransforms(const UT_Array<UT_Matrix4D>& xforms, const UT_XformOrder& xform_order,
+	UT_Array<UT_Vector3D>& t_out, UT_Array<UT_Vector3D>& r_out, UT_Array<UT_Vector3D>& s_out);
 
     static bool getPostRotateAdjust(const UT_StringRef &node_type, FbxVector4 &post_rotate);
     static void doPostRotateAdjust(FbxVector4 &post_rotate, const FbxVector4 &adjustment);
 
     static OP_Node* findOpInput(OP_Node *op, const char * const find_op_types[], bool include_me, const char* const  allowed_node_types[], bool *did_find_allowed_only, int rec_level = 0, UT_Set<OP_Node*> *already_visited=NULL);
     static bool findTimeDependentNode(OP_Node *op, const char * const ignored_node_types[], const char * const opt_more_types[], fpreal ftime, bool include_me, UT_Set<OP_Node*> *already_visited=NULL);
-    static void setStandardTransforms(OP_Node* hd_node, FbxNode* fbx_node, ROP_FBXBaseNodeVisitInfo *node_info, fpreal bone_length, fpreal ftime, bool use_world_transform = false);
+    static void setStandardTransforms(OP_Node* hd_node, FbxNode* fbx_node, ROP_FBXBaseNodeVisitInfo *node_info, fpreal bone_length, fpreal ftime, bool use_world_transform = false, ROP_FBXTransformCache* xform_cache = NULL);
     static OP_Node* findNonInstanceTargetFromInstance(OP_Node* instance_ptr, fpreal ftime);
 
     static GA_PrimCompat::TypeMask getGdpPrimId(const GU_Detail* gdp);
+    /// Hashes the topology and the public attributes of gdp, so that details with the same hash
+    /// export to the same mesh. Returns false if some attribute couldn't be hashed.
+    static bool hashGeometry(const GU_Detail* gdp, SYS_HashType& hash_out);
 
     static bool isDummyBone(OP_Node* bone_node, fpreal ftime);
     static bool isJointNullNode(OP_Node* null_node, fpreal ftime);
@@ -170,6 +231,10 @@ public:
     void setSourcePrimitive(int prim_cnt);
     int getSourcePrimitive(void);
 
+    /// Point indices of the surface CVs, in vertex cache order. Only set for surface vertex caches.
+    void setCVPointIndices(const UT_IntArray& cv_points);
+    const UT_IntArray& getCVPointIndices(void) const;
+
     void setTraveledInputIndex(int idx);
     int getTraveledInputIndex(void);
 
@@ -177,6 +242,14 @@ public:
     int getBlendShapeNodeCount() const;
     OP_Node* getBlendShapeNodeAt(const int& index);
 
+    /// Node that was the parent of this one when it was visited. NULL at the top level.
+    OP_Node* getParentHdNode(void) const;
+    void setParentHdNode(OP_Node* node);
+
+    /// True if this node has been added to the animated nodes of the node manager.
+    bool getIsPossiblyAnimated(void) const;
+    void setIsPossiblyAnimated(bool value);
+
 private:
     FbxNode* myFbxNode;
 
@@ -195,15 +268,92 @@ private:
     int myTravelledIndex;
 
     int mySourcePrim;
+    UT_IntArray myCVPointIndices;
 
     std::vector<OP_Node*> myBlendShapeNodes;
+
+    OP_Node* myParentHdNode;
+    bool myIsPossiblyAnimated;
+
+    // Next info added for the same OP_Node, maintained by ROP_FBXNodeManager.
+    ROP_FBXNodeInfo* myNextForHdNode;
+
+    friend class ROP_FBXNodeManager;
 };
-typedef std::multimap < OP_Node* , ROP_FBXNodeInfo* > THDToNodeInfoMap;
-typedef std::map < FbxNode* , ROP_FBXNodeInfo* > TFbxToNodeInfoMap;
 typedef std::map < OP_Node*, FbxNode* > THdNodeToFbxNodeMap;
 typedef std::vector < ROP_FBXNodeInfo* > TFbxNodeInfoVector;
 typedef std::set < OP_Node* > THDNodeSet;
 /********************************************************************************************************/
+// Keeps track of the memory used by the frames of all vertex caches in an export, so that
+// the caches can spill frames to disk when a budget is set.
+class ROP_FBXGDPCacheBudget
+{
+public:
+    ROP_FBXGDPCacheBudget();
+    ~ROP_FBXGDPCacheBudget();
+
+    /// Budget in bytes. Zero or less means there is no budget.
+    void setBudget(int64 num_bytes);
+    int64 getBudget(void);
+    bool getIsOverBudget(void);
+
+    void addResidentBytes(int64 num_bytes);
+    void removeResidentBytes(int64 num_bytes);
+
+    int64 getResidentBytes(void);
+    int64 getPeakResidentBytes(void);
+
+private:
+    int64 myBudget;
+    int64 myResidentBytes;
+    int64 myPeakResidentBytes;
+};
+/********************************************************************************************************/
+// Remembers the world transforms of the nodes evaluated during an export, so that parents
+// shared by many nodes (such as the bones of a chain) are only evaluated once per time. Only
+// the most recently used times are kept, since nodes get sampled a frame at a time. This is
+// not thread safe.
+class ROP_FBXTransformCache
+{
+public:
+    ROP_FBXTransformCache();
+    ~ROP_FBXTransformCache();
+
+    void clear(void);
+
+    void getWorldTransform(OP_Node* hd_node, fpreal time, UT_Matrix4D& xform_out);
+    void getInverseWorldTransform(OP_Node* hd_node, fpreal time, UT_Matrix4D& xform_out);
+
+private:
+    struct ROP_FBXTransformCacheEntry
+    {
+	ROP_FBXTransformCacheEntry() : myHasWorld(false), myHasInverseWorld(false) { }
+
+	UT_Matrix4D myWorld;
+	UT_Matrix4D myInverseWorld;
+	bool myHasWorld;
+	bool myHasInverseWorld;
+    };
+    typedef std::unordered_map < OP_Node*, ROP_FBXTransformCacheEntry > TTransformCacheEntries;
+
+    struct ROP_FBXTransformCacheSlot
+    {
+	ROP_FBXTransformCacheSlot() : myTime(0.0), myLastUse(0), myIsUsed(false) { }
+
+	fpreal myTime;
+	exint myLastUse;
+	bool myIsUsed;
+	TTransformCacheEntries myEntries;
+    };
+
+    ROP_FBXTransformCacheEntry& findEntry(OP_Node* hd_node, fpreal time);
+
+    static const int theNumSlots = 4;
+    ROP_FBXTransformCacheSlot mySlots[theNumSlots];
+    int myLastSlot;
+    exint myUseCounter;
+};
+/********************************************************************************************************/
 class ROP_FBXNodeManager
 {
 public:
@@ -220,15 +370,52 @@ public:
     void addBundledNode(OP_Node* hd_node);
     bool isNodeBundled(OP_Node* hd_node);
 
+    /// Nodes whose animation has to be exported, in the order they were added. Nodes that
+    /// aren't in here can't be animated.
+    void addAnimatedNodeInfo(ROP_FBXNodeInfo* node_info);
+    const TFbxNodeInfoVector& getAnimatedNodeInfos(void) const;
+
+    ROP_FBXGDPCacheBudget& getGDPCacheBudget(void);
+    ROP_FBXTransformCache& getTransformCache(void);
+    ROP_FBXTraversalIndex& getTraversalIndex(void);
+
 private:
-    THDToNodeInfoMap myHdToNodeInfoMap;
-    TFbxToNodeInfoMap myFbxToNodeInfoMap;
+    ROP_FBXNodeInfo& allocNodeInfo(void);
+    ROP_FBXNodeInfo& getNodeInfo(exint index);
+
+    // Node infos are allocated in blocks that are never moved, so that pointers to them stay
+    // valid, and are all freed together.
+    static const exint theNodeInfoBlockSize = 256;
+    UT_Array<ROP_FBXNodeInfo*> myNodeInfoBlocks;
+    exint myNumNodeInfos;
+
+    // Infos for the same OP_Node are chained through myNextForHdNode, in the order they
+    // were added.
+    struct ROP_FBXNodeInfoChain
+    {
+	ROP_FBXNodeInfo* myFirst;
+	ROP_FBXNodeInfo* myLast;
+    };
+    UT_ArrayMap<OP_Node*, ROP_FBXNodeInfoChain> myHdToNodeInfos;
+    UT_ArrayMap<FbxNode*, ROP_FBXNodeInfo*> myFbxToNodeInfo;
 
     // TStringSet myNamesSet; Removed as a fix for RFE #67311, more detailed 
     //                        comment in the .c file makeNameUnique()
 
     // Includes all nodes that are in the bundles we're exporting.
     THDNodeSet myNodesInBundles;
+
+    // Node infos that may be animated, recorded by the main visitor.
+    TFbxNodeInfoVector myAnimatedNodeInfos;
+
+    // Shared by all vertex caches.
+    ROP_FBXGDPCacheBudget myGDPCacheBudget;
+
+    // World transforms evaluated so far during the export.
+    ROP_FBXTransformCache myTransformCache;
+
+    // Node outputs looked up by all the visitors of the export.
+    ROP_FBXTraversalIndex myTraversalIndex;
 };
 /********************************************************************************************************/
 class ROP_FBXGDPCacheItem
@@ -246,7 +433,38 @@ private:
 };
 typedef std::vector < ROP_FBXGDPCacheItem* > TGeomCacheItems;
 /********************************************************************************************************/
+// A single frame's worth of positions. These are kept in memory until the budget
+// runs out (or right away, when saving memory), at which point they're written
+// out to the positions file.
+class ROP_FBXGDPCachePositionsRecord
+{
+public:
+    ROP_FBXGDPCachePositionsRecord() { myNumPoints = 0; myNumPreProcPoints = -1; myIsResident = true; myOffset = -1; myPreProcOffset = -1; }
+    ~ROP_FBXGDPCachePositionsRecord() { }
+
+    int64 getMemoryUsage(void) { return myPositions.getMemoryUsage(false) + myPreProcPositions.getMemoryUsage(false); }
+
+    // Positions of the converted (vertex cacheable) geometry.
+    UT_Vector3FArray myPositions;
+    int myNumPoints;
+
+    // Positions of the converted, but not triangulated geometry. Only stored while
+    // the point count is constant, since that's the only time they are needed.
+    UT_Vector3FArray myPreProcPositions;
+    int myNumPreProcPoints;
+
+    // Point counts are -1 when the positions aren't available.
+
+    // False once the positions have been written to the positions file.
+    bool myIsResident;
+    int64 myOffset;
+    int64 myPreProcOffset;
+};
+typedef std::vector < ROP_FBXGDPCachePositionsRecord* > TPositionsRecords;
+/********************************************************************************************************/
 // NOTE: This class assumes frames are added in increasing order, and no frames are skipped.
+// Only the first frame's full geometry is kept, for its topology. Every frame
+// (including the first) keeps its point positions, which is all the vertex cache needs.
 class ROP_FBXGDPCache
 {
 public:
@@ -260,6 +478,11 @@ public:
 
     void setNumConstantPoints(int num_points);
     int getNumConstantPoints(void);
+
+    /// Hash of the cooked points and connectivity over all frames, used to tell if 
+    /// a previously written vertex cache file is still valid.
+    void setContentHash(SYS_HashType hash);
+    SYS_HashType getContentHash(void);
     bool getIsNumPointsConstant(void);
 
     void clearFrames(void);
@@ -267,15 +490,57 @@ public:
     bool getSaveMemory(void);
     void setSaveMemory(bool value);
 
+    /// When set, frame positions over the budget are spilled to a scratch file (oldest
+    /// first) and read back from there. The budget is not owned by the cache.
+    void setMemoryBudget(ROP_FBXGDPCacheBudget* budget);
+    ROP_FBXGDPCacheBudget* getMemoryBudget(void);
+
     int getNumFrames(void) { return myFrameItems.size(); }
 
+    /// Stores the converted positions of a frame, so that the vertex cache can
+    /// be written out later without cooking the geometry a second time.
+    /// When saving memory, these go straight to a temporary file.
+    /// @param	gdp			The converted (vertex cacheable) frame geometry, or NULL if
+    ///					nothing was cooked for this frame.
+    /// @param	pre_proc_positions	Optional positions of the converted, but not triangulated geometry.
+    void addFramePositions(fpreal frame_num, const GU_Detail* gdp, const UT_Vector3FArray* pre_proc_positions);
+    /// Same as above, but takes over the contents of already gathered positions arrays.
+    void addFramePositions(fpreal frame_num, UT_Vector3FArray& positions, UT_Vector3FArray* pre_proc_positions);
+    /// Reads back the positions stored by addFramePositions(), padding with zeros up to
+    /// num_array_points. Returns false if the frame (or the requested kind of positions) 
+    /// wasn't stored, in which case the caller has to cook the geometry itself.
+    bool getFramePositions(fpreal frame_num, bool pre_proc, double* vert_array, int num_array_points);
+    bool getFramePositions(fpreal frame_num, bool pre_proc, float* vert_array, int num_array_points);
+    /// Frees one kind of positions for all frames, once we know they won't be needed.
+    void discardFramePositions(bool pre_proc);
+    void clearFramePositions(void);
+
+private:
+    void enforceMemoryBudget(void);
+    bool spillPositions(ROP_FBXGDPCachePositionsRecord* record);
+    bool writePositions(const UT_Vector3FArray& positions, int64& offset_out);
+    bool lookupFramePositions(fpreal frame_num, bool pre_proc, const UT_Vector3F*& positions_out, int& num_points_in_out);
+
 private:
     TGeomCacheItems myFrameItems;
     fpreal myMinFrame;
     int myNumConstantPoints;
+    SYS_HashType myContentHash;
 
     // Use less memory by not actually caching anything
     bool mySaveMemory;
+
+    ROP_FBXGDPCacheBudget* myMemoryBudget;
+
+    // Frame positions
+    TPositionsRecords myPositionsRecords;
+    fpreal myPositionsMinFrame;
+    int myFirstResidentRecord;
+    std::fstream* myPositionsFile;
+    std::string myPositionsFileName;
+    int64 myPositionsFileSize;
+    bool myPositionsFileFailed;
+    UT_Vector3FArray myPositionsBuffer;
 };
 typedef std::set < ROP_FBXGDPCache* > TGDPCacheSet;
 /********************************************************************************************************/